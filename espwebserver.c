@@ -1,5 +1,6 @@
 #include <WiFi.h>
 #include <WebServer.h>
+#include <LittleFS.h>
 
 WebServer server(80);
 HardwareSerial& arduinoSerial = Serial2;
@@ -7,29 +8,55 @@ HardwareSerial& arduinoSerial = Serial2;
 const char* ssid = "PharmacySystem";
 const char* password = "12345678";
 
-// Medicine database
+// Medicine database, the array index is the medicine id (SKU). Where
+// each one is stored comes from the Arduino's shelf map, see shelfSku.
 struct Medicine {
   String name;
-  int shelfRow;
-  int shelfCol;
   int stock;
+  const char* icon;
 };
 
-Medicine medicines[12] = {
-  {"Paracetamol 500mg", 0, 0, 50},
-  {"Ibuprofen 400mg", 0, 1, 30},
-  {"Amoxicillin 250mg", 0, 2, 40},
-  {"Omeprazole 20mg", 0, 3, 25},
-  {"Aspirin 100mg", 1, 0, 60},
-  {"Cetirizine 10mg", 1, 1, 45},
-  {"Metformin 500mg", 1, 2, 35},
-  {"Atorvastatin 20mg", 1, 3, 20},
-  {"Salbutamol Inhaler", 2, 0, 15},
-  {"Loratadine 10mg", 2, 1, 30},
-  {"Diazepam 5mg", 2, 2, 10},
-  {"Ciprofloxacin 500mg", 2, 3, 25}
+Medicine medicines[] = {
+  {"Paracetamol 500mg", 50, "fa-tablets"},
+  {"Ibuprofen 400mg", 30, "fa-capsules"},
+  {"Amoxicillin 250mg", 40, "fa-prescription-bottle"},
+  {"Omeprazole 20mg", 25, "fa-capsules"},
+  {"Aspirin 100mg", 60, "fa-tablets"},
+  {"Cetirizine 10mg", 45, "fa-pills"},
+  {"Metformin 500mg", 35, "fa-prescription-bottle-alt"},
+  {"Atorvastatin 20mg", 20, "fa-tablets"},
+  {"Salbutamol Inhaler", 15, "fa-lungs"},
+  {"Loratadine 10mg", 30, "fa-pills"},
+  {"Diazepam 5mg", 10, "fa-prescription-bottle"},
+  {"Ciprofloxacin 500mg", 25, "fa-capsules"}
 };
 
+#define MEDICINE_COUNT (int)(sizeof(medicines) / sizeof(medicines[0]))
+
+// Shelf map as last listed by the Arduino's MAP command, row-major.
+// Written by the robot task, read by the catalog handler.
+#define SHELF_MAX_SLOTS 64
+#define SHELF_NO_SKU 0xFF
+
+uint8_t shelfRows = 0;
+uint8_t shelfCols = 0;
+uint8_t shelfSku[SHELF_MAX_SLOTS];
+
+// Catalog search index, built once at boot. Every 3-character window of
+// each lower-cased name is hashed and stored with the medicine id, sorted
+// so all medicines sharing a trigram are adjacent.
+#define CATALOG_PAGE_SIZE 24
+#define CATALOG_MAX_PAGE_SIZE 50
+
+struct TrigramEntry {
+  uint16_t trigram;
+  uint16_t medicineId;
+};
+
+String catalogNames[MEDICINE_COUNT];   // lower-cased names for matching
+TrigramEntry* catalogIndex = NULL;
+int catalogIndexSize = 0;
+
 struct OrderItem {
   int medicineId;
   String medicineName;
@@ -44,6 +71,145 @@ int orderSize = 0;
 bool isProcessingOrder = false;
 bool systemPaused = false;
 
+// Networking runs on core 0 next to the WiFi stack, the robot link on
+// core 1. They only talk through these queues and the command status
+// below, so a slow HTTP client can't hold up the UART and a
+// half-received line can't stall HTTP.
+#define NETWORK_CORE 0
+#define ROBOT_CORE 1
+#define ROBOT_LINE_LEN 64
+#define COMMAND_QUEUE_LEN 16
+#define EVENT_QUEUE_LEN 32
+
+struct RobotLine {
+  char text[ROBOT_LINE_LEN];
+  uint32_t id;   // command number given by /cmd, 0 otherwise
+};
+
+QueueHandle_t commandQueue;   // HTTP -> Arduino
+QueueHandle_t controlQueue;   // PAUSE, RESUME, ABORT: HTTP -> Arduino, never held
+QueueHandle_t eventQueue;     // Arduino -> network task
+volatile bool arduinoReady = false;
+
+// The Arduino runs one command at a time. robotTask holds the next one
+// until the running command's DONE line, so every result line belongs to
+// the command that is running. The page follows its own commands by the
+// number /cmd returns in X-Command-Id, see /api/robot.
+#define COMMAND_HISTORY 8
+#define ROBOT_COMMAND_TIMEOUT_MS 300000   // Arduino silent this long: stop waiting
+#define ROBOT_PROBE_MS 2000    // resend MAP this often until the Arduino answers
+#define ARDUINO_CMD_LEN 40     // CMD_LEN in arduinocode, longer lines are cut
+
+enum CommandState {
+  COMMAND_QUEUED,
+  COMMAND_RUNNING,
+  COMMAND_DONE,      // DONE:<command>
+  COMMAND_DROPPED    // cleared by ABORT or an Arduino reset before it ran
+};
+
+struct CommandStatus {
+  uint32_t id;
+  uint8_t state;   // CommandState
+  uint8_t units;   // UNIT_RETRIEVED lines so far
+};
+
+CommandStatus commandHistory[COMMAND_HISTORY];   // slot id % COMMAND_HISTORY
+uint32_t lastHandledId = 0;    // newest command started or dropped
+SemaphoreHandle_t commandLock; // guards commandHistory and lastHandledId
+uint32_t nextCommandId = 0;    // network task only
+uint32_t runningCommandId = 0; // robot task only, from here down
+char runningCommand[ARDUINO_CMD_LEN];   // as the Arduino echoes it in DONE:
+bool robotBusy = false;
+bool robotPaused = false;
+unsigned long lastArduinoLine = 0;
+
+// Request ids recently accepted by /cmd, only used by the network task
+#define RECENT_REQUESTS 32
+String recentRequests[RECENT_REQUESTS];
+int recentRequestNext = 0;
+
+// Dispense audit log: fixed-size records in a circular file. Records are
+// numbered by seq and stored at slot seq % AUDIT_LOG_RECORDS. The robot
+// task hands them to logTask through auditQueue; logTask batches them
+// and writes them to flash, so the order path never waits on flash.
+#define AUDIT_LOG_PATH "/audit.log"
+#define AUDIT_LOG_RECORDS 4096          // 64 KB of flash
+#define AUDIT_BLOCK_RECORDS 64          // records per index entry
+#define AUDIT_BLOCKS (AUDIT_LOG_RECORDS / AUDIT_BLOCK_RECORDS)
+#define AUDIT_BATCH_RECORDS 16          // flush when this many are pending
+#define AUDIT_FLUSH_MS 5000             // or when the oldest is this old
+#define AUDIT_QUERY_LIMIT 500
+#define AUDIT_NO_SKU 0xFF
+#define AUDIT_NO_SLOT 0xFF
+
+// Catalog ids are stored in a byte, with 0xFF kept for "unknown"
+static_assert(MEDICINE_COUNT <= AUDIT_NO_SKU, "catalog ids must stay below AUDIT_NO_SKU");
+
+enum AuditResult {
+  AUDIT_RETRIEVED,     // UNIT_RETRIEVED, one record per box
+  AUDIT_FAILED,        // ERROR:FAILED_TO RETRIVE
+  AUDIT_NOT_AVAILABLE, // ERROR:MED_NOT_ON_AVAILBLE
+  AUDIT_ABORTED        // ABORTED:<row>-<col>
+};
+
+struct __attribute__((packed)) AuditRecord {
+  uint32_t seq;
+  uint32_t timestamp;  // seconds, see logClock()
+  uint32_t cycleMs;    // command sent to result received
+  uint8_t sku;         // medicine id, AUDIT_NO_SKU if unknown
+  uint8_t slot;        // row << 4 | col (both < 15), AUDIT_NO_SLOT if unknown
+  uint8_t result;      // AuditResult
+  uint8_t retries;     // ERROR:BOX_NOT_ON_PLATFORM count
+};
+
+// Dispense job currently running on the Arduino, owned by robotTask.
+// Commands run one at a time (see robotTask), so every result line until
+// the command's DONE line belongs to this job.
+struct DispenseJob {
+  bool active;
+  unsigned long startMs;
+  uint8_t sku;
+  uint8_t slot;
+  uint8_t retries;
+  bool bySku;   // P command, may go on to another slot
+};
+
+DispenseJob currentJob = {false, 0, AUDIT_NO_SKU, AUDIT_NO_SLOT, 0, false};
+QueueHandle_t auditQueue;              // robot task -> log task
+SemaphoreHandle_t auditLock;           // guards the file, batch and index
+AuditRecord auditBatch[AUDIT_BATCH_RECORDS];
+int auditBatchCount = 0;
+uint32_t auditNextSeq = 0;             // seq of the next record
+uint32_t auditBlockStart[AUDIT_BLOCKS];  // timestamp of each block's first record
+volatile uint32_t logClockBase = 0;    // log clock at boot
+
+// Declared up front so the file also builds as plain C++ on the host
+// (see host/), where no prototypes are generated for us.
+bool isRecentRequest(const String& requestId);
+void rememberRequest(const String& requestId);
+void networkTask(void* param);
+void robotTask(void* param);
+void readArduinoLines();
+void handleArduinoLine(const RobotLine& line);
+void queueRobotCommand(const char* text);
+void startRobotCommand(const RobotLine& cmd);
+void finishRobotCommand(CommandState state);
+void setCommandState(uint32_t id, CommandState state);
+void dropQueuedCommands();
+void handleRobotQuery();
+void updateShelfMap(const char* text);
+String shelfSlots(int sku);
+void startDispenseJob(const char* cmd);
+uint8_t packSlot(int row, int col);
+void trackDispenseJob(const char* text);
+void auditDispense(AuditResult result);
+uint32_t logClock();
+void openAuditLog();
+void logTask(void* param);
+void handleAuditQuery();
+void buildCatalogIndex();
+void handleCatalogQuery();
+
 void setup() {
   Serial.begin(115200);
   arduinoSerial.begin(115200, SERIAL_8N1, 16, 17);
@@ -53,15 +219,17 @@ void setup() {
   Serial.print("AP IP address: ");
   Serial.println(IP);
 
-  // Wait for Arduino to initialize
+  commandQueue = xQueueCreate(COMMAND_QUEUE_LEN, sizeof(RobotLine));
+  controlQueue = xQueueCreate(COMMAND_QUEUE_LEN, sizeof(RobotLine));
+  commandLock = xSemaphoreCreateMutex();
+  eventQueue = xQueueCreate(EVENT_QUEUE_LEN, sizeof(RobotLine));
+  auditQueue = xQueueCreate(AUDIT_BATCH_RECORDS * 2, sizeof(AuditRecord));
+  auditLock = xSemaphoreCreateMutex();
+  openAuditLog();
+  buildCatalogIndex();
+
+  // Commands are held in the queue until the Arduino reports ready
   Serial.println("Waiting for Arduino...");
-  while (!arduinoSerial.available()) {
-    delay(100);
-  }
-  String response = arduinoSerial.readStringUntil('\n');
-  if (response.startsWith("ARDUINO_READY")) {
-    Serial.println("Arduino ready");
-  }
 
   server.on("/", HTTP_GET, []() {
     String html = R"rawliteral(<!DOCTYPE html>
@@ -589,6 +757,9 @@ void setup() {
       <button class="btn btn-warning" id="pauseBtn" onclick="togglePause()">
         <i class="fas fa-pause"></i> Pause
       </button>
+      <button class="btn btn-danger" onclick="abortJob()">
+        <i class="fas fa-stop"></i> Stop
+      </button>
       <button class="btn btn-danger" onclick="clearCart()">
         <i class="fas fa-trash"></i> Clear Cart
       </button>
@@ -623,37 +794,71 @@ void setup() {
   <script>
     let cart = [];
     let isPaused = false;
-    const medicines = [
-      {id: 0, name: "Paracetamol 500mg", shelf: "0-0", stock: 50, icon: "fa-tablets"},
-      {id: 1, name: "Ibuprofen 400mg", shelf: "0-1", stock: 30, icon: "fa-capsules"},
-      {id: 2, name: "Amoxicillin 250mg", shelf: "0-2", stock: 40, icon: "fa-prescription-bottle"},
-      {id: 3, name: "Omeprazole 20mg", shelf: "0-3", stock: 25, icon: "fa-capsules"},
-      {id: 4, name: "Aspirin 100mg", shelf: "1-0", stock: 60, icon: "fa-tablets"},
-      {id: 5, name: "Cetirizine 10mg", shelf: "1-1", stock: 45, icon: "fa-pills"},
-      {id: 6, name: "Metformin 500mg", shelf: "1-2", stock: 35, icon: "fa-prescription-bottle-alt"},
-      {id: 7, name: "Atorvastatin 20mg", shelf: "1-3", stock: 20, icon: "fa-tablets"},
-      {id: 8, name: "Salbutamol Inhaler", shelf: "2-0", stock: 15, icon: "fa-lungs"},
-      {id: 9, name: "Loratadine 10mg", shelf: "2-1", stock: 30, icon: "fa-pills"},
-      {id: 10, name: "Diazepam 5mg", shelf: "2-2", stock: 10, icon: "fa-prescription-bottle"},
-      {id: 11, name: "Ciprofloxacin 500mg", shelf: "2-3", stock: 25, icon: "fa-capsules"}
-    ];
+    let activeCommand = null;   // pick the robot is running for this page, see processNextItem
+    const MAX_UNITS_PER_PICK = 10;   // the firmware rejects larger picks
+    let orderShort = false;   // some units of this order could not be dispensed
+    // Medicines seen so far, filled page by page from /api/catalog
+    const medicines = new Map();
+    let catalogQuery = '';
+    let catalogPage = 0;
+    let catalogTotal = 0;
+    let catalogPer = 24;
+    let catalogLoading = false;
+    let searchTimer = null;
 
     function filterMedicines() {
-      const searchTerm = document.getElementById('searchInput').value.toLowerCase();
-      const medicineCards = document.querySelectorAll('.medicine-card');
-      
-      medicineCards.forEach(card => {
-        const name = card.querySelector('.medicine-name').textContent.toLowerCase();
-        if (name.includes(searchTerm)) {
-          card.style.display = 'flex';
-        } else {
-          card.style.display = 'none';
-        }
-      });
+      clearTimeout(searchTimer);
+      searchTimer = setTimeout(() => {
+        catalogQuery = document.getElementById('searchInput').value.trim();
+        document.getElementById('medicineContainer').innerHTML = '';
+        catalogPage = 0;
+        catalogTotal = 0;
+        loadCatalogPage();
+      }, 150);
+    }
+
+    function loadCatalogPage() {
+      if (catalogLoading) return;
+      catalogLoading = true;
+      const query = catalogQuery;
+      fetch(`/api/catalog?q=${encodeURIComponent(query)}&page=${catalogPage}`)
+        .then(r => r.json())
+        .then(data => {
+          catalogLoading = false;
+          if (query !== catalogQuery) {   // search changed while loading
+            loadCatalogPage();
+            return;
+          }
+          catalogTotal = data.total;
+          catalogPer = data.per;
+          catalogPage++;
+          data.items.forEach(item => {
+            const med = {id: item.id, name: item.n, shelf: item.s, stock: item.k, icon: item.i};
+            medicines.set(med.id, med);
+            renderMedicineCard(med);
+          });
+          if (catalogTotal === 0) {
+            document.getElementById('medicineContainer').innerHTML = '<div class="empty-cart">No medicines found</div>';
+          }
+          loadMoreIfVisible();
+        })
+        .catch(() => {
+          catalogLoading = false;
+          updateStatus("Could not load medicines");
+        });
+    }
+
+    // Fetch the next page once the end of the grid scrolls into view
+    function loadMoreIfVisible() {
+      const container = document.getElementById('medicineContainer');
+      const hasMore = catalogPage * catalogPer < catalogTotal;
+      if (hasMore && container.getBoundingClientRect().bottom < window.innerHeight + 300) {
+        loadCatalogPage();
+      }
     }
 
     function addToCart(medId, quantity = null) {
-      const med = medicines.find(m => m.id === medId);
+      const med = medicines.get(medId);
       const qty = quantity || parseInt(document.getElementById(`qty-${medId}`).value);
       
       if (qty > med.stock) {
@@ -730,13 +935,14 @@ void setup() {
       }
       
       cart[0].status = 'processing';
+      orderShort = false;
       updateCart();
       updateStatus("Processing order...");
       processNextItem();
     }
 
     function processNextItem() {
-      if (isPaused || cart.length === 0) return;
+      if (isPaused || cart.length === 0 || activeCommand) return;
       
       const item = cart[0];
       if (item.processedCount >= item.quantity) {
@@ -749,21 +955,55 @@ void setup() {
           updateStatus(`Processing next item: ${cart[0].name}`);
           setTimeout(processNextItem, 1000);
         } else {
-          updateStatus("Order completed successfully!");
+          updateStatus(orderShort ? "Order finished, some items could not be dispensed" : "Order completed successfully!");
         }
         return;
       }
       
-      item.processedCount++;
-      updateCart();
-  sendCommand(`S${item.shelf}`);
-      
-      setTimeout(() => {
-        if (!isPaused) {
-          sendCommand("HOME");
+      // The robot takes up to MAX_UNITS_PER_PICK units in one trip without
+      // homing in between, and homes by itself afterwards
+      const units = Math.min(item.quantity - item.processedCount, MAX_UNITS_PER_PICK);
+      // processedCount only counts boxes the robot confirmed on the ramp
+      activeCommand = {id: null, item: item, units: units, done: item.processedCount, aborted: false};
+      sendCommand(`P${item.id}x${units}`)
+        .then(r => {
+          if (!r.ok) throw new Error();
+          activeCommand.id = r.headers.get('X-Command-Id');
+          waitForCommand();
+        })
+        .catch(() => {
+          activeCommand = null;
+          updateStatus("Robot busy, retrying...");
           setTimeout(processNextItem, 2000);
-        }
-      }, 2000);
+        });
+    }
+
+    // The next line goes only once the robot has finished this one
+    function waitForCommand() {
+      const command = activeCommand;
+      fetch(`/api/robot?id=${command.id}`)
+        .then(r => r.json())
+        .then(status => {
+          const item = command.item;
+          // "unknown": finished too long ago to be remembered, assume it went through
+          const delivered = status.state === 'unknown' ? command.units : status.units;
+          item.processedCount = command.done + delivered;
+          updateCart();
+          if (status.state === 'queued' || status.state === 'running') {
+            setTimeout(waitForCommand, 500);
+            return;
+          }
+          activeCommand = null;
+          if (command.aborted) return;   // the rest waits for Resume
+          if (delivered < command.units) {
+            // Out of stock or the pick failed: don't keep retrying the line
+            updateStatus(`${item.name}: ${command.units - delivered} could not be dispensed`);
+            item.quantity = item.processedCount;
+            orderShort = true;
+          }
+          setTimeout(processNextItem, delivered < command.units ? 3000 : 1000);
+        })
+        .catch(() => setTimeout(waitForCommand, 1000));
     }
 
     function updateCart() {
@@ -786,7 +1026,7 @@ void setup() {
               <div class="item-name">${item.name}</div>
               <div class="item-details">
                 <span>Qty: ${item.quantity}</span>
-                <span>Shelf: ${item.shelf}</span>
+                <span>Shelf: ${item.shelf || '-'}</span>
               </div>
               <div class="item-status status-${item.status}">
                 ${item.status === 'processing' 
@@ -805,12 +1045,9 @@ void setup() {
     }
 
     function togglePause() {
-      isPaused = !isPaused;
-      const btn = document.getElementById('pauseBtn');
-      btn.innerHTML = isPaused ? '<i class="fas fa-play"></i> Resume' : '<i class="fas fa-pause"></i> Pause';
-      btn.className = isPaused ? 'btn btn-success' : 'btn btn-warning';
-      
-      updateStatus(isPaused ? "System paused" : "System resumed");
+      // The robot slows to a stop mid-move and carries on from there on resume
+      sendCommand(isPaused ? 'RESUME' : 'PAUSE');
+      setPaused(!isPaused);
       
       if (!isPaused && cart.length > 0 && cart[0].status === 'processing') {
         updateStatus("Resuming order processing...");
@@ -818,54 +1055,76 @@ void setup() {
       }
     }
 
+    function abortJob() {
+      sendCommand('ABORT');
+      // Units already on the ramp stay counted; Resume picks the rest
+      if (activeCommand) activeCommand.aborted = true;
+      setPaused(true);
+      updateStatus("Robot stopped - check the tray, then Resume for the rest");
+    }
+
+    function setPaused(paused) {
+      isPaused = paused;
+      const btn = document.getElementById('pauseBtn');
+      btn.innerHTML = isPaused ? '<i class="fas fa-play"></i> Resume' : '<i class="fas fa-pause"></i> Pause';
+      btn.className = isPaused ? 'btn btn-success' : 'btn btn-warning';
+      
+      updateStatus(isPaused ? "System paused" : "System resumed");
+    }
+
     function sendCommand(cmd) {
-      fetch("/cmd?command=" + cmd);
+      return fetch("/cmd?command=" + cmd);
     }
 
     function updateStatus(msg) {
       document.getElementById("statusText").innerText = msg;
     }
 
-    // Initialize medicine cards
-    document.addEventListener('DOMContentLoaded', function() {
+    function renderMedicineCard(med) {
       const container = document.getElementById('medicineContainer');
+      const progress = Math.min(100, (med.stock / 50) * 100);
       
-      medicines.forEach(med => {
-        const progress = Math.min(100, (med.stock / 50) * 100);
-        
-        const card = document.createElement('div');
-        card.className = 'medicine-card';
-        card.innerHTML = `
-          <div class="medicine-header">
-            <div class="medicine-icon">
-              <i class="fas ${med.icon}"></i>
-            </div>
-            <div>
-              <div class="medicine-name">${med.name}</div>
-              <div class="medicine-shelf">Shelf ${med.shelf}</div>
-            </div>
+      const card = document.createElement('div');
+      card.className = 'medicine-card';
+      card.innerHTML = `
+        <div class="medicine-header">
+          <div class="medicine-icon">
+            <i class="fas ${med.icon}"></i>
           </div>
-          <div class="medicine-body">
-            <div class="medicine-stock">
-              <span>In stock:</span>
-              <span class="stock-count">${med.stock}</span>
-            </div>
-            <div class="stock-bar">
-              <div class="stock-progress" style="width: ${progress}%"></div>
-            </div>
-            <div class="medicine-controls">
-              <select class="quantity-selector" id="qty-${med.id}">
-                ${Array.from({length: Math.min(5, med.stock)}, (_, i) => 
-                  `
+          <div>
+            <div class="medicine-name">${med.name}</div>
+            <div class="medicine-shelf">${med.shelf ? `Shelf ${med.shelf}` : 'Not on a shelf'}</div>
+          </div>
+        </div>
+        <div class="medicine-body">
+          <div class="medicine-stock">
+            <span>In stock:</span>
+            <span class="stock-count">${med.stock}</span>
+          </div>
+          <div class="stock-bar">
+            <div class="stock-progress" style="width: ${progress}%"></div>
+          </div>
+          <div class="medicine-controls">
+            <select class="quantity-selector" id="qty-${med.id}">
+              ${Array.from({length: Math.min(5, med.stock)}, (_, i) => 
+                `
 <option value="${i+1}">${i+1}</option>`).join('')}
-              </select>
-              <button class="add-btn" id="add-btn-${med.id}" onclick="addToCart(${med.id})">
-                <i class="fas fa-plus"></i> Add
-              </button>
-            </div>
-          </div>`;
-        container.appendChild(card);
-      });
+            </select>
+            <button class="add-btn" id="add-btn-${med.id}" onclick="addToCart(${med.id})">
+              <i class="fas fa-plus"></i> Add
+            </button>
+          </div>
+        </div>`;
+      container.appendChild(card);
+    }
+
+    // Initialize medicine cards
+    document.addEventListener('DOMContentLoaded', function() {
+      // Give the robot's audit log a wall clock
+      fetch("/api/time?set=" + Math.floor(Date.now() / 1000));
+
+      window.addEventListener('scroll', loadMoreIfVisible);
+      loadCatalogPage();
     });
   </script>
 </body>
@@ -874,24 +1133,651 @@ void setup() {
   });
 
   server.on("/cmd", HTTP_GET, []() {
-    String command = server.arg("command");
-    arduinoSerial.println(command);
+    // Terminals replaying queued requests tag them with rid=
+    String requestId = server.arg("rid");
+    if (requestId.length() > 0 && isRecentRequest(requestId)) {
+      server.send(200, "text/plain", "Duplicate ignored");
+      return;
+    }
+    RobotLine cmd;
+    String text = server.arg("command");
+    text.trim();   // the Arduino trims it too before echoing it in DONE:
+    strlcpy(cmd.text, text.c_str(), sizeof(cmd.text));
+    // These act on the running command, so they don't wait behind it
+    bool control = strcmp(cmd.text, "PAUSE") == 0 || strcmp(cmd.text, "RESUME") == 0 ||
+                   strcmp(cmd.text, "ABORT") == 0;
+    cmd.id = control ? 0 : nextCommandId + 1;
+    if (xQueueSend(control ? controlQueue : commandQueue, &cmd, 0) != pdTRUE) {
+      server.send(503, "text/plain", "Robot busy");
+      return;
+    }
+    if (!control) nextCommandId++;
+    if (requestId.length() > 0) rememberRequest(requestId);
+    server.sendHeader("X-Command-Id", String(cmd.id));
     server.send(200, "text/plain", "Command sent");
   });
 
+  server.on("/api/log", HTTP_GET, handleAuditQuery);
+  server.on("/api/robot", HTTP_GET, handleRobotQuery);
+  server.on("/api/catalog", HTTP_GET, handleCatalogQuery);
+
+  // The ESP32 has no RTC, so the page sets the log clock from the browser
+  server.on("/api/time", HTTP_GET, []() {
+    uint32_t epoch = strtoul(server.arg("set").c_str(), NULL, 10);
+    uint32_t now = logClock();
+    if (epoch > now) logClockBase += epoch - now;   // never run backwards
+    server.send(200, "application/json", "{\"now\":" + String(logClock()) + "}");
+  });
+
   server.begin();
+
+  xTaskCreatePinnedToCore(networkTask, "network", 8192, NULL, 1, NULL, NETWORK_CORE);
+  xTaskCreatePinnedToCore(robotTask, "robot", 4096, NULL, 2, NULL, ROBOT_CORE);
+  xTaskCreatePinnedToCore(logTask, "log", 4096, NULL, 0, NULL, NETWORK_CORE);
 }
 
 void loop() {
-  server.handleClient();
-  if (arduinoSerial.available()) {
-    String response = arduinoSerial.readStringUntil('\n');
-    Serial.println("Arduino: " + response);
+  // All work happens in networkTask and robotTask
+  vTaskDelete(NULL);
+}
+
+bool isRecentRequest(const String& requestId) {
+  for (int i = 0; i < RECENT_REQUESTS; i++) {
+    if (recentRequests[i] == requestId) return true;
   }
+  return false;
 }
 
+void rememberRequest(const String& requestId) {
+  recentRequests[recentRequestNext] = requestId;
+  recentRequestNext = (recentRequestNext + 1) % RECENT_REQUESTS;
+}
 
+void networkTask(void* param) {
+  RobotLine event;
+  for (;;) {
+    server.handleClient();
+    while (xQueueReceive(eventQueue, &event, 0) == pdTRUE) {
+      Serial.println("Arduino: " + String(event.text));
+    }
+    vTaskDelay(1);
+  }
+}
 
+void robotTask(void* param) {
+  RobotLine cmd;
+  unsigned long lastProbe = millis() - ROBOT_PROBE_MS;
+  for (;;) {
+    // After an ESP reset the Arduino may have been up all along and will
+    // not print ARDUINO_READY again, so ask for the map until it answers
+    if (!arduinoReady && millis() - lastProbe >= ROBOT_PROBE_MS) {
+      arduinoSerial.println("MAP");
+      lastProbe = millis();
+    }
 
+    while (xQueueReceive(controlQueue, &cmd, 0) == pdTRUE) {
+      if (strcmp(cmd.text, "ABORT") == 0) dropQueuedCommands();
+      robotPaused = strcmp(cmd.text, "PAUSE") == 0;
+      arduinoSerial.println(cmd.text);
+    }
+    if (robotBusy && !robotPaused && millis() - lastArduinoLine > ROBOT_COMMAND_TIMEOUT_MS) {
+      finishRobotCommand(COMMAND_DONE);
+    }
 
+    // Sleep until a command can go, but wake often enough to drain the UART
+    if (arduinoReady && !robotBusy && xQueueReceive(commandQueue, &cmd, pdMS_TO_TICKS(2)) == pdTRUE) {
+      startRobotCommand(cmd);
+    } else if (!arduinoReady || robotBusy) {
+      vTaskDelay(pdMS_TO_TICKS(2));
+    }
+    readArduinoLines();
+  }
+}
+
+// Commands the server sends on its own, ahead of anything waiting
+void queueRobotCommand(const char* text) {
+  RobotLine cmd;
+  strlcpy(cmd.text, text, sizeof(cmd.text));
+  cmd.id = 0;
+  xQueueSendToFront(commandQueue, &cmd, 0);
+}
 
+void startRobotCommand(const RobotLine& cmd) {
+  startDispenseJob(cmd.text);
+  setCommandState(cmd.id, COMMAND_RUNNING);
+  runningCommandId = cmd.id;
+  strlcpy(runningCommand, cmd.text, sizeof(runningCommand));
+  robotBusy = true;
+  lastArduinoLine = millis();
+  arduinoSerial.println(cmd.text);
+}
+
+void finishRobotCommand(CommandState state) {
+  setCommandState(runningCommandId, state);
+  robotBusy = false;
+}
+
+void setCommandState(uint32_t id, CommandState state) {
+  if (id == 0) return;
+  xSemaphoreTake(commandLock, portMAX_DELAY);
+  CommandStatus& status = commandHistory[id % COMMAND_HISTORY];
+  if (status.id != id) status = {id, COMMAND_QUEUED, 0};
+  status.state = state;
+  if (id > lastHandledId) lastHandledId = id;
+  xSemaphoreGive(commandLock);
+}
+
+// ABORT also clears everything waiting behind the running command, as
+// the Arduino does with its own queue
+void dropQueuedCommands() {
+  RobotLine cmd;
+  while (xQueueReceive(commandQueue, &cmd, 0) == pdTRUE) {
+    setCommandState(cmd.id, COMMAND_DROPPED);
+  }
+}
+
+// Collect UART bytes into lines without blocking on a partial line
+void readArduinoLines() {
+  static RobotLine line;
+  static size_t len = 0;
+
+  while (arduinoSerial.available()) {
+    char c = arduinoSerial.read();
+    if (c == '\r') continue;
+    if (c != '\n') {
+      if (len < sizeof(line.text) - 1) line.text[len++] = c;
+      continue;
+    }
+    line.text[len] = '\0';
+    len = 0;
+    handleArduinoLine(line);
+  }
+}
+
+void handleArduinoLine(const RobotLine& line) {
+  lastArduinoLine = millis();
+  if (strncmp(line.text, "ARDUINO_READY", 13) == 0) {
+    arduinoReady = true;
+    if (robotBusy) finishRobotCommand(COMMAND_DROPPED);   // the Arduino restarted
+    queueRobotCommand("MAP");   // learn which medicine sits where
+  } else if (strncmp(line.text, "MAP:", 4) == 0 || strncmp(line.text, "DONE:", 5) == 0) {
+    arduinoReady = true;   // answering a probe or finishing older work
+  }
+  updateShelfMap(line.text);
+  trackDispenseJob(line.text);
+  // Drop the event rather than block the robot link if the network side lags
+  xQueueSend(eventQueue, &line, 0);
+
+  if (!robotBusy) return;
+  if (strncmp(line.text, "DONE:", 5) == 0) {
+    // A probe that crossed ARDUINO_READY can still answer late
+    if (strcmp(line.text + 5, runningCommand) == 0) finishRobotCommand(COMMAND_DONE);
+  } else if (strncmp(line.text, "DROPPED:", 8) == 0 || strncmp(line.text, "ERROR:QUEUE_FULL", 16) == 0) {
+    finishRobotCommand(COMMAND_DROPPED);
+  } else if (strncmp(line.text, "UNIT_RETRIEVED:", 15) == 0 && runningCommandId != 0) {
+    xSemaphoreTake(commandLock, portMAX_DELAY);
+    commandHistory[runningCommandId % COMMAND_HISTORY].units++;
+    xSemaphoreGive(commandLock);
+  }
+}
+
+// Follow the Arduino's MAP listing, and ask for it again whenever a slot
+// or the grid size is changed
+void updateShelfMap(const char* text) {
+  if (strncmp(text, "MAP:", 4) == 0) {
+    const char* x = strchr(text, 'x');
+    memset(shelfSku, SHELF_NO_SKU, sizeof(shelfSku));
+    shelfCols = x ? atoi(x + 1) : 0;
+    shelfRows = atoi(text + 4);
+  } else if (strncmp(text, "SLOT", 4) == 0 && isdigit((unsigned char)text[4])) {
+    // SLOT<row>-<col>X<cm>Y<cm>Z<cm>K<sku>F<flags>
+    const char* dash = strchr(text, '-');
+    const char* sku = strchr(text, 'K');
+    if (!dash || !sku) return;
+    int row = atoi(text + 4);
+    int col = atoi(dash + 1);
+    int id = atoi(sku + 1);
+    if (row < shelfRows && col < shelfCols && row * shelfCols + col < SHELF_MAX_SLOTS &&
+        id >= 0 && id < SHELF_NO_SKU) {
+      shelfSku[row * shelfCols + col] = id;
+    }
+  } else if (strncmp(text, "ACK:SLOT", 8) == 0 || strncmp(text, "ACK:CFG", 7) == 0) {
+    queueRobotCommand("MAP");
+  }
+}
+
+// "<row>-<col>" of every slot holding this medicine, space separated
+String shelfSlots(int sku) {
+  int rows = shelfRows, cols = shelfCols;
+  String slots;
+  for (int i = 0; i < rows * cols && i < SHELF_MAX_SLOTS; i++) {
+    if (shelfSku[i] != sku) continue;
+    if (slots.length() > 0) slots += " ";
+    slots += String(i / cols) + "-" + String(i % cols);
+  }
+  return slots;
+}
+
+// Remember what was asked for so the result line can be logged with it
+void startDispenseJob(const char* cmd) {
+  if (!isdigit((unsigned char)cmd[1])) return;
+
+  if (cmd[0] == 'P') {
+    int sku = atoi(cmd + 1);
+    currentJob = {true, millis(), sku < AUDIT_NO_SKU ? (uint8_t)sku : (uint8_t)AUDIT_NO_SKU,
+                  AUDIT_NO_SLOT, 0, true};
+  } else if (cmd[0] == 'S') {
+    const char* dash = strchr(cmd, '-');
+    if (!dash) return;
+    int row = atoi(cmd + 1);
+    int col = atoi(dash + 1);
+    currentJob = {true, millis(), AUDIT_NO_SKU, packSlot(row, col), 0, false};
+    if (row < shelfRows && col < shelfCols && row * shelfCols + col < SHELF_MAX_SLOTS) {
+      currentJob.sku = shelfSku[row * shelfCols + col];
+    }
+  }
+}
+
+uint8_t packSlot(int row, int col) {
+  if (row < 0 || row > 14 || col < 0 || col > 14) return AUDIT_NO_SLOT;
+  return row << 4 | col;
+}
+
+uint8_t parseSlot(const char* text) {
+  const char* dash = strchr(text, '-');
+  if (!dash) return AUDIT_NO_SLOT;
+  return packSlot(atoi(text), atoi(dash + 1));
+}
+
+void trackDispenseJob(const char* text) {
+  if (!currentJob.active) return;
+
+  if (strncmp(text, "SLOT:", 5) == 0) {
+    currentJob.slot = parseSlot(text + 5);
+  } else if (strcmp(text, "ERROR:BOX_NOT_ON_PLATFORM") == 0) {
+    currentJob.retries++;
+  } else if (strncmp(text, "UNIT_RETRIEVED:", 15) == 0) {
+    // Multi-unit picks log each box; the next one is timed from here.
+    // S picks stay on their slot and never print SLOT: again.
+    currentJob.slot = parseSlot(text + 15);
+    auditDispense(AUDIT_RETRIEVED);
+    currentJob.startMs = millis();
+    if (currentJob.bySku) currentJob.slot = AUDIT_NO_SLOT;
+    currentJob.retries = 0;
+  } else if (strncmp(text, "MEDICINE_RETRIEVED:", 19) == 0) {
+    currentJob.active = false;
+  } else if (strncmp(text, "ABORTED:", 8) == 0) {
+    currentJob.slot = parseSlot(text + 8);
+    auditDispense(AUDIT_ABORTED);
+    currentJob.active = false;
+  } else if (strcmp(text, "ERROR:FAILED_TO RETRIVE") == 0) {
+    auditDispense(AUDIT_FAILED);
+    currentJob.active = false;
+  } else if (strcmp(text, "ERROR:MED_NOT_ON_AVAILBLE") == 0) {
+    auditDispense(AUDIT_NOT_AVAILABLE);
+    // A P command may go on to another slot, so its job stays open
+    currentJob.active = currentJob.bySku;
+    currentJob.startMs = millis();
+    currentJob.slot = AUDIT_NO_SLOT;
+    currentJob.retries = 0;
+  } else if (strncmp(text, "DONE:", 5) == 0 || strncmp(text, "DROPPED:", 8) == 0) {
+    currentJob.active = false;
+  }
+}
+
+void auditDispense(AuditResult result) {
+  AuditRecord record;
+  record.seq = 0;   // assigned by logTask
+  record.timestamp = logClock();
+  record.cycleMs = millis() - currentJob.startMs;
+  record.sku = currentJob.sku;
+  record.slot = currentJob.slot;
+  record.result = result;
+  record.retries = currentJob.retries;
+  xQueueSend(auditQueue, &record, 0);
+}
+
+const char* commandStateName(uint8_t state) {
+  switch (state) {
+    case COMMAND_QUEUED: return "queued";
+    case COMMAND_RUNNING: return "running";
+    case COMMAND_DONE: return "done";
+    default: return "dropped";
+  }
+}
+
+// GET /api/robot?id= , progress of a command accepted by /cmd
+void handleRobotQuery() {
+  uint32_t id = strtoul(server.arg("id").c_str(), NULL, 10);
+  const char* state = "unknown";   // too old to be remembered
+  int units = 0;
+
+  xSemaphoreTake(commandLock, portMAX_DELAY);
+  const CommandStatus& status = commandHistory[id % COMMAND_HISTORY];
+  if (id > lastHandledId && id <= nextCommandId) {
+    state = commandStateName(COMMAND_QUEUED);
+  } else if (id > 0 && status.id == id) {
+    state = commandStateName(status.state);
+    units = status.units;
+  }
+  xSemaphoreGive(commandLock);
+
+  server.send(200, "application/json", "{\"id\":" + String(id) + ",\"state\":\"" + state +
+              "\",\"units\":" + String(units) + "}");
+}
+
+uint32_t logClock() {
+  return logClockBase + millis() / 1000;
+}
+
+size_t auditOffset(uint32_t seq) {
+  return (size_t)(seq % AUDIT_LOG_RECORDS) * sizeof(AuditRecord);
+}
+
+// Read one record from flash or from the unflushed batch
+bool readAuditRecord(File& file, uint32_t seq, AuditRecord& record) {
+  uint32_t flushed = auditNextSeq - auditBatchCount;
+  if (seq >= flushed) {
+    record = auditBatch[seq - flushed];
+    return true;
+  }
+  return file.seek(auditOffset(seq)) &&
+         file.read((uint8_t*)&record, sizeof(record)) == sizeof(record);
+}
+
+// Find the head of the log and rebuild the block index. Only the first
+// record of each block is read, plus one block to find the newest record.
+void openAuditLog() {
+  if (!LittleFS.begin(true)) {
+    Serial.println("Audit log unavailable");
+    return;
+  }
+  if (!LittleFS.exists(AUDIT_LOG_PATH)) {
+    File created = LittleFS.open(AUDIT_LOG_PATH, "w");
+    created.close();
+  }
+
+  File file = LittleFS.open(AUDIT_LOG_PATH, "r");
+  size_t stored = file.size() / sizeof(AuditRecord);
+  AuditRecord record;
+
+  // Block whose first record is newest holds the head
+  int headBlock = -1;
+  uint32_t headSeq = 0;
+  for (size_t b = 0; b * AUDIT_BLOCK_RECORDS < stored; b++) {
+    file.seek(b * AUDIT_BLOCK_RECORDS * sizeof(AuditRecord));
+    file.read((uint8_t*)&record, sizeof(record));
+    if (headBlock == -1 || record.seq > headSeq) {
+      headBlock = b;
+      headSeq = record.seq;
+    }
+  }
+
+  if (headBlock != -1) {
+    // Records in the head block are consecutive up to the newest one
+    size_t end = min(stored, (size_t)(headBlock + 1) * AUDIT_BLOCK_RECORDS);
+    uint32_t lastTimestamp = 0;
+    for (size_t i = headBlock * AUDIT_BLOCK_RECORDS; i < end; i++) {
+      file.seek(i * sizeof(AuditRecord));
+      file.read((uint8_t*)&record, sizeof(record));
+      if (record.seq != headSeq + (i - headBlock * AUDIT_BLOCK_RECORDS)) break;
+      lastTimestamp = record.timestamp;
+      auditNextSeq = record.seq + 1;
+    }
+    logClockBase = lastTimestamp + 1;
+
+    uint32_t oldest = auditNextSeq > AUDIT_LOG_RECORDS ? auditNextSeq - AUDIT_LOG_RECORDS : 0;
+    for (uint32_t seq = (oldest + AUDIT_BLOCK_RECORDS - 1) / AUDIT_BLOCK_RECORDS * AUDIT_BLOCK_RECORDS;
+         seq < auditNextSeq; seq += AUDIT_BLOCK_RECORDS) {
+      file.seek(auditOffset(seq));
+      file.read((uint8_t*)&record, sizeof(record));
+      auditBlockStart[seq / AUDIT_BLOCK_RECORDS % AUDIT_BLOCKS] = record.timestamp;
+    }
+  }
+  file.close();
+
+  Serial.println("Audit log: " + String(auditNextSeq) + " records written");
+}
+
+void flushAuditBatch() {
+  if (auditBatchCount == 0) return;
+
+  File file = LittleFS.open(AUDIT_LOG_PATH, "r+");
+  if (file) {
+    uint32_t seq = auditNextSeq - auditBatchCount;
+    // A batch that wraps past the end of the file is written in two parts
+    int first = min(auditBatchCount, (int)(AUDIT_LOG_RECORDS - seq % AUDIT_LOG_RECORDS));
+    file.seek(auditOffset(seq));
+    file.write((const uint8_t*)auditBatch, first * sizeof(AuditRecord));
+    if (first < auditBatchCount) {
+      file.seek(0);
+      file.write((const uint8_t*)(auditBatch + first), (auditBatchCount - first) * sizeof(AuditRecord));
+    }
+    file.close();
+  }
+  auditBatchCount = 0;
+}
+
+void logTask(void* param) {
+  AuditRecord record;
+  unsigned long oldestPending = 0;
+  for (;;) {
+    bool received = xQueueReceive(auditQueue, &record, pdMS_TO_TICKS(500)) == pdTRUE;
+
+    xSemaphoreTake(auditLock, portMAX_DELAY);
+    if (received) {
+      record.seq = auditNextSeq++;
+      if (record.seq % AUDIT_BLOCK_RECORDS == 0) {
+        auditBlockStart[record.seq / AUDIT_BLOCK_RECORDS % AUDIT_BLOCKS] = record.timestamp;
+      }
+      if (auditBatchCount == 0) oldestPending = millis();
+      auditBatch[auditBatchCount++] = record;
+    }
+    if (auditBatchCount == AUDIT_BATCH_RECORDS ||
+        (auditBatchCount > 0 && millis() - oldestPending >= AUDIT_FLUSH_MS)) {
+      flushAuditBatch();
+    }
+    xSemaphoreGive(auditLock);
+  }
+}
+
+// First seq that may hold a record at or after `from`. Timestamps never
+// decrease with seq, so a binary search over the block index narrows the
+// scan to a single block.
+uint32_t findAuditStart(File& file, uint32_t from) {
+  uint32_t oldest = auditNextSeq > AUDIT_LOG_RECORDS ? auditNextSeq - AUDIT_LOG_RECORDS : 0;
+  uint32_t lo = (oldest + AUDIT_BLOCK_RECORDS - 1) / AUDIT_BLOCK_RECORDS;
+  uint32_t hi = (auditNextSeq + AUDIT_BLOCK_RECORDS - 1) / AUDIT_BLOCK_RECORDS;
+  uint32_t start = oldest;
+
+  // Last block that starts before `from`
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (auditBlockStart[mid % AUDIT_BLOCKS] < from) {
+      start = mid * AUDIT_BLOCK_RECORDS;
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  AuditRecord record;
+  while (start < auditNextSeq && readAuditRecord(file, start, record) && record.timestamp < from) {
+    start++;
+  }
+  return start;
+}
+
+const char* auditResultName(uint8_t result) {
+  switch (result) {
+    case AUDIT_RETRIEVED: return "retrieved";
+    case AUDIT_FAILED: return "failed";
+    case AUDIT_ABORTED: return "aborted";
+    default: return "not_available";
+  }
+}
+
+// GET /api/log?from=&to=&limit= , times in log clock seconds
+void handleAuditQuery() {
+  uint32_t from = server.hasArg("from") ? strtoul(server.arg("from").c_str(), NULL, 10) : 0;
+  uint32_t to = server.hasArg("to") ? strtoul(server.arg("to").c_str(), NULL, 10) : UINT32_MAX;
+  int limit = server.hasArg("limit") ? server.arg("limit").toInt() : 100;
+  limit = constrain(limit, 1, AUDIT_QUERY_LIMIT);
+
+  String json;
+  json.reserve(64 + limit * 80);
+  json = "{\"now\":" + String(logClock()) + ",\"records\":[";
+
+  xSemaphoreTake(auditLock, portMAX_DELAY);
+  File file = LittleFS.open(AUDIT_LOG_PATH, "r");
+  uint32_t seq = findAuditStart(file, from);
+  int count = 0;
+  AuditRecord record;
+  bool more = false;
+  for (; seq < auditNextSeq && readAuditRecord(file, seq, record); seq++) {
+    if (record.timestamp > to) break;
+    if (count == limit) {
+      more = true;
+      break;
+    }
+    if (count++) json += ",";
+    json += "{\"t\":" + String(record.timestamp);
+    json += ",\"sku\":" + String(record.sku == AUDIT_NO_SKU ? -1 : record.sku);
+    json += ",\"slot\":\"";
+    if (record.slot != AUDIT_NO_SLOT) json += String(record.slot >> 4) + "-" + String(record.slot & 0x0F);
+    json += "\",\"result\":\"" + String(auditResultName(record.result));
+    json += "\",\"retries\":" + String(record.retries);
+    json += ",\"ms\":" + String(record.cycleMs) + "}";
+  }
+  file.close();
+  xSemaphoreGive(auditLock);
+
+  json += "],\"more\":" + String(more ? "true" : "false") + "}";
+  server.send(200, "application/json", json);
+}
+
+uint16_t trigramHash(const char* text) {
+  return (uint16_t)((uint8_t)text[0] * 961 + (uint8_t)text[1] * 31 + (uint8_t)text[2]);
+}
+
+int compareTrigramEntries(const void* a, const void* b) {
+  const TrigramEntry* x = (const TrigramEntry*)a;
+  const TrigramEntry* y = (const TrigramEntry*)b;
+  if (x->trigram != y->trigram) return x->trigram < y->trigram ? -1 : 1;
+  return (int)x->medicineId - (int)y->medicineId;
+}
+
+void buildCatalogIndex() {
+  int total = 0;
+  for (int i = 0; i < MEDICINE_COUNT; i++) {
+    catalogNames[i] = medicines[i].name;
+    catalogNames[i].toLowerCase();
+    if (catalogNames[i].length() >= 3) total += catalogNames[i].length() - 2;
+  }
+
+  catalogIndex = (TrigramEntry*)malloc(total * sizeof(TrigramEntry));
+  catalogIndexSize = 0;
+  for (int i = 0; i < MEDICINE_COUNT; i++) {
+    const char* name = catalogNames[i].c_str();
+    for (int j = 0; j + 2 < (int)catalogNames[i].length(); j++) {
+      catalogIndex[catalogIndexSize++] = {trigramHash(name + j), (uint16_t)i};
+    }
+  }
+  qsort(catalogIndex, catalogIndexSize, sizeof(TrigramEntry), compareTrigramEntries);
+
+  // A name repeating a trigram only needs one entry
+  int kept = 0;
+  for (int i = 0; i < catalogIndexSize; i++) {
+    if (kept == 0 || compareTrigramEntries(&catalogIndex[i], &catalogIndex[kept - 1]) != 0) {
+      catalogIndex[kept++] = catalogIndex[i];
+    }
+  }
+  catalogIndexSize = kept;
+}
+
+// First index entry with this trigram
+int findTrigram(uint16_t trigram) {
+  int lo = 0, hi = catalogIndexSize;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (catalogIndex[mid].trigram < trigram) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// Calls match(id) for every medicine whose name contains the query, in
+// id order. Longer queries only check the medicines listed under their
+// rarest trigram; hash collisions are removed by the substring check.
+void searchCatalog(String query, std::function<void(int)> match) {
+  query.toLowerCase();
+  query.trim();
+  const char* q = query.c_str();
+  int qlen = query.length();
+
+  if (qlen < 3) {
+    for (int i = 0; i < MEDICINE_COUNT; i++) {
+      if (strstr(catalogNames[i].c_str(), q)) match(i);
+    }
+    return;
+  }
+
+  int bestStart = 0, bestCount = -1;
+  for (int j = 0; j + 2 < qlen; j++) {
+    uint16_t trigram = trigramHash(q + j);
+    int start = findTrigram(trigram);
+    int end = start;
+    while (end < catalogIndexSize && catalogIndex[end].trigram == trigram) end++;
+    if (bestCount == -1 || end - start < bestCount) {
+      bestStart = start;
+      bestCount = end - start;
+    }
+  }
+
+  for (int i = bestStart; i < bestStart + bestCount; i++) {
+    int id = catalogIndex[i].medicineId;
+    if (strstr(catalogNames[id].c_str(), q)) match(id);
+  }
+}
+
+// GET /api/catalog?q=&page=&per= , or ?id= for a single medicine.
+// fmt=txt answers "<total>" then "<id>:<name>" lines for the keypad terminal.
+void handleCatalogQuery() {
+  int page = max(0, (int)server.arg("page").toInt());
+  int per = server.hasArg("per") ? server.arg("per").toInt() : CATALOG_PAGE_SIZE;
+  per = constrain(per, 1, CATALOG_MAX_PAGE_SIZE);
+  bool text = server.arg("fmt") == "txt";
+
+  int first = page * per;
+  int total = 0;
+  String items;
+  items.reserve(per * 96);
+  auto add = [&](int id) {
+    if (total >= first && total < first + per) {
+      const Medicine& med = medicines[id];
+      if (text) {
+        items += String(id) + ":" + med.name + "\n";
+      } else {
+        if (total > first) items += ",";
+        items += "{\"id\":" + String(id) + ",\"n\":\"" + med.name + "\",\"s\":\"" +
+                 shelfSlots(id) + "\",\"k\":" +
+                 String(med.stock) + ",\"i\":\"" + med.icon + "\"}";
+      }
+    }
+    total++;
+  };
+
+  if (server.hasArg("id")) {
+    int id = server.arg("id").toInt();
+    if (id >= 0 && id < MEDICINE_COUNT) add(id);
+  } else {
+    searchCatalog(server.arg("q"), add);
+  }
+
+  if (text) {
+    server.send(200, "text/plain", String(total) + "\n" + items);
+  } else {
+    server.send(200, "application/json", "{\"total\":" + String(total) + ",\"page\":" +
+                String(page) + ",\"per\":" + String(per) + ",\"items\":[" + items + "]}");
+  }
+}
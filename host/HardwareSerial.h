@@ -0,0 +1,64 @@
+// Serial port whose two directions are byte queues the harness can reach
+#pragma once
+
+#define SERIAL_8N1 0x800001c
+
+class HardwareSerial {
+ public:
+  // Called with every complete line the sketch writes
+  std::function<void(const String&)> onLine;
+  bool echo = false;
+
+  void begin(unsigned long, uint32_t = SERIAL_8N1, int = -1, int = -1) {}
+
+  int available() {
+    std::lock_guard<std::mutex> guard(lock);
+    return rx.size();
+  }
+
+  int read() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (rx.empty()) return -1;
+    int c = rx.front();
+    rx.pop_front();
+    return c;
+  }
+
+  template <class T> size_t print(const T& v) { return write(String(v)); }
+  template <class T> size_t println(const T& v) { return write(String(v) + "\n"); }
+  size_t print(const char* v) { return write(String(v)); }
+  size_t println(const char* v) { return write(String(v) + "\n"); }
+  size_t println() { return write(String("\n")); }
+
+  // Harness side: bytes the sketch will read
+  void inject(const String& text) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (unsigned i = 0; i < text.length(); i++) rx.push_back(text[i]);
+  }
+
+ private:
+  std::mutex lock;
+  std::deque<char> rx;
+  String pending;
+
+  size_t write(const String& text) {
+    if (echo) fputs(text.c_str(), stdout);
+    std::vector<String> lines;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      for (unsigned i = 0; i < text.length(); i++) {
+        if (text[i] == '\n') {
+          lines.push_back(pending);
+          pending = String();
+        } else if (text[i] != '\r') {
+          pending += text[i];
+        }
+      }
+    }
+    if (onLine) for (auto& line : lines) onLine(line);
+    return text.length();
+  }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial2;
@@ -0,0 +1,48 @@
+// LittleFS on top of a host directory (PHARMAX_FS_DIR, default ./fs)
+#pragma once
+#include <sys/stat.h>
+#include "Arduino.h"
+
+class File {
+ public:
+  File(FILE* f = nullptr) : f(f) {}
+  explicit operator bool() const { return f != nullptr; }
+  size_t size() {
+    long here = ftell(f);
+    fseek(f, 0, SEEK_END);
+    long end = ftell(f);
+    fseek(f, here, SEEK_SET);
+    return end;
+  }
+  bool seek(uint32_t pos) { return fseek(f, pos, SEEK_SET) == 0; }
+  size_t read(uint8_t* buf, size_t len) { return fread(buf, 1, len, f); }
+  size_t write(const uint8_t* buf, size_t len) { return fwrite(buf, 1, len, f); }
+  void close() {
+    if (f) fclose(f);
+    f = nullptr;
+  }
+
+ private:
+  FILE* f;
+};
+
+class LittleFSFS {
+ public:
+  bool begin(bool formatOnFail = false) {
+    const char* env = getenv("PHARMAX_FS_DIR");
+    root = env ? env : "fs";
+    mkdir(root.c_str(), 0755);
+    return true;
+  }
+  bool exists(const char* path) {
+    struct stat st;
+    return stat((root + path).c_str(), &st) == 0;
+  }
+  File open(const char* path, const char* mode) { return File(fopen((root + path).c_str(), mode)); }
+  bool remove(const char* path) { return ::remove((root + path).c_str()) == 0; }
+
+ private:
+  std::string root;
+};
+
+extern LittleFSFS LittleFS;
@@ -0,0 +1,124 @@
+// In-process WebServer: load generator threads queue requests, the
+// sketch's handleClient() serves one per call like the real server does.
+#pragma once
+#include <future>
+#include <map>
+#include "Arduino.h"
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_POST };
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+
+struct MockResponse {
+  int code = 0;
+  String contentType;
+  std::string body;
+};
+
+class WebServer {
+ public:
+  typedef std::function<void()> THandlerFunction;
+
+  explicit WebServer(int port = 80) {}
+
+  void on(const String& uri, HTTPMethod method, THandlerFunction handler) {
+    routes[std::string(uri.c_str())] = handler;
+  }
+  void onNotFound(THandlerFunction handler) { notFound = handler; }
+  void begin() {}
+
+  void handleClient() {
+    Pending* request;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if (pending.empty()) return;
+      request = pending.front();
+      pending.pop_front();
+    }
+    current = request;
+    auto route = routes.find(request->path);
+    if (route != routes.end()) {
+      route->second();
+    } else if (notFound) {
+      notFound();
+    } else {
+      send(404, "text/plain", "Not found");
+    }
+    current = nullptr;
+    request->done.set_value(request->response);
+    delete request;
+  }
+
+  String uri() { return String(current->path); }
+  String arg(const String& name) {
+    auto it = current->args.find(name.c_str());
+    return it == current->args.end() ? String() : String(it->second);
+  }
+  bool hasArg(const String& name) { return current->args.count(name.c_str()) > 0; }
+
+  void sendHeader(const String&, const String&, bool = false) {}
+  void setContentLength(size_t) {}
+  void send(int code, const char* type, const String& body) {
+    current->response.code = code;
+    current->response.contentType = type;
+    current->response.body += body.c_str();
+  }
+  void send(int code, const String& type, const String& body) { send(code, type.c_str(), body); }
+  void send(int code, const char* type = "text/plain") { send(code, type, String()); }
+  void sendContent(const String& chunk) { current->response.body += chunk.c_str(); }
+
+  // Harness side: queue "GET <target>" and wait for the sketch to answer
+  std::future<MockResponse> request(const std::string& target) {
+    Pending* request = new Pending;
+    size_t q = target.find('?');
+    request->path = target.substr(0, q);
+    if (q != std::string::npos) parseQuery(target.substr(q + 1), request->args);
+    auto result = request->done.get_future();
+    std::lock_guard<std::mutex> guard(lock);
+    pending.push_back(request);
+    return result;
+  }
+
+ private:
+  struct Pending {
+    std::string path;
+    std::map<std::string, std::string> args;
+    MockResponse response;
+    std::promise<MockResponse> done;
+  };
+
+  std::map<std::string, THandlerFunction> routes;
+  THandlerFunction notFound;
+  std::mutex lock;
+  std::deque<Pending*> pending;
+  Pending* current = nullptr;
+
+  static void parseQuery(const std::string& query, std::map<std::string, std::string>& args) {
+    size_t start = 0;
+    while (start <= query.size()) {
+      size_t end = query.find('&', start);
+      if (end == std::string::npos) end = query.size();
+      std::string pair = query.substr(start, end - start);
+      size_t eq = pair.find('=');
+      if (!pair.empty()) {
+        args[pair.substr(0, eq)] = eq == std::string::npos ? "" : decode(pair.substr(eq + 1));
+      }
+      start = end + 1;
+    }
+  }
+
+  static std::string decode(const std::string& text) {
+    std::string out;
+    for (size_t i = 0; i < text.size(); i++) {
+      if (text[i] == '+') {
+        out += ' ';
+      } else if (text[i] == '%' && i + 2 < text.size()) {
+        out += (char)strtol(text.substr(i + 1, 2).c_str(), nullptr, 16);
+        i += 2;
+      } else {
+        out += text[i];
+      }
+    }
+    return out;
+  }
+};
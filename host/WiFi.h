@@ -0,0 +1,20 @@
+#pragma once
+#include "Arduino.h"
+
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+
+struct IPAddress {
+  uint8_t a, b, c, d;
+  operator String() const {
+    return String((int)a) + "." + String((int)b) + "." + String((int)c) + "." + String((int)d);
+  }
+};
+
+class WiFiClass {
+ public:
+  bool softAP(const char*, const char*) { return true; }
+  IPAddress softAPIP() { return {192, 168, 4, 1}; }
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,111 @@
+// FreeRTOS queues, mutexes and tasks mapped onto the C++ standard library
+#pragma once
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void*);
+typedef void* TaskHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY 0xffffffffUL
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+struct MockQueue {
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<std::vector<uint8_t>> items;
+  size_t length;
+  size_t itemSize;
+};
+typedef MockQueue* QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  QueueHandle_t q = new MockQueue;
+  q->length = length;
+  q->itemSize = itemSize;
+  return q;
+}
+
+inline bool mockWait(std::unique_lock<std::mutex>& guard, QueueHandle_t q, TickType_t ticks,
+                     const std::function<bool()>& ready) {
+  if (ticks == portMAX_DELAY) {
+    q->changed.wait(guard, ready);
+    return true;
+  }
+  return q->changed.wait_for(guard, std::chrono::milliseconds(ticks), ready);
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t ticks) {
+  std::unique_lock<std::mutex> guard(q->lock);
+  if (!mockWait(guard, q, ticks, [q] { return q->items.size() < q->length; })) return pdFALSE;
+  const uint8_t* p = (const uint8_t*)item;
+  q->items.emplace_back(p, p + q->itemSize);
+  q->changed.notify_all();
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueSendToFront(QueueHandle_t q, const void* item, TickType_t ticks) {
+  std::unique_lock<std::mutex> guard(q->lock);
+  if (!mockWait(guard, q, ticks, [q] { return q->items.size() < q->length; })) return pdFALSE;
+  const uint8_t* p = (const uint8_t*)item;
+  q->items.emplace_front(p, p + q->itemSize);
+  q->changed.notify_all();
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t ticks) {
+  std::unique_lock<std::mutex> guard(q->lock);
+  if (!mockWait(guard, q, ticks, [q] { return !q->items.empty(); })) return pdFALSE;
+  memcpy(item, q->items.front().data(), q->itemSize);
+  q->items.pop_front();
+  q->changed.notify_all();
+  return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+  std::lock_guard<std::mutex> guard(q->lock);
+  return q->items.size();
+}
+
+typedef std::recursive_timed_mutex* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new std::recursive_timed_mutex; }
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t ticks) {
+  if (ticks == portMAX_DELAY) {
+    m->lock();
+    return pdTRUE;
+  }
+  return m->try_lock_for(std::chrono::milliseconds(ticks)) ? pdTRUE : pdFALSE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t m) {
+  m->unlock();
+  return pdTRUE;
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks ? ticks : 0));
+  std::this_thread::yield();
+}
+
+// Set on threads running sketch code, so the load test can tell the
+// sketch's heap use from its own
+inline thread_local bool mockSketchThread = false;
+
+// Core affinity and priority are ignored, every task is a detached thread
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char*, uint32_t, void* param,
+                                          UBaseType_t, TaskHandle_t* handle, BaseType_t) {
+  std::thread([fn, param] {
+    mockSketchThread = true;
+    fn(param);
+  }).detach();
+  if (handle) *handle = nullptr;
+  return pdPASS;
+}
+
+inline void vTaskDelete(TaskHandle_t) {}
@@ -0,0 +1,333 @@
+// Load generator for espwebserver.c on the host.
+//
+// Client threads replay a mix of page, catalog, log and dispense requests
+// against the mock WebServer while a scripted Arduino answers the robot
+// link. Reports throughput, latency percentiles and the heap high-water
+// mark so server changes can be measured before flashing a device.
+//
+//   make && ./loadtest --clients 8 --seconds 10 --pick-ms 40
+#include <malloc.h>
+#include <atomic>
+#include <random>
+#include "Arduino.h"
+#include "WiFi.h"
+#include "WebServer.h"
+#include "LittleFS.h"
+
+HardwareSerial Serial;
+HardwareSerial Serial2;
+WiFiClass WiFi;
+LittleFSFS LittleFS;
+
+extern WebServer server;
+void setup();
+
+// ---- Heap accounting: every allocation in the process goes through here,
+// but only blocks allocated on sketch threads (see mockSketchThread) are
+// counted, until they are freed on whichever thread. The harness's own
+// samples and requests stay out of the figure.
+
+extern "C" void* __libc_malloc(size_t);
+extern "C" void* __libc_calloc(size_t, size_t);
+extern "C" void* __libc_realloc(void*, size_t);
+extern "C" void __libc_free(void*);
+
+std::atomic<long> heapInUse(0);
+std::atomic<long> heapPeak(0);
+
+// Open-addressing table of the counted blocks, static so it never
+// allocates itself
+const size_t TRACKED_BLOCKS = 1 << 16;
+struct TrackedBlock {
+  void* p;
+  size_t size;
+};
+TrackedBlock tracked[TRACKED_BLOCKS];
+std::atomic_flag trackedLock = ATOMIC_FLAG_INIT;
+
+static size_t trackedSlot(void* p) {
+  return ((uintptr_t)p >> 4) * 0x9E3779B97F4A7C15ull >> 48 & (TRACKED_BLOCKS - 1);
+}
+
+static void trackAlloc(void* p) {
+  if (!p) return;
+  size_t size = malloc_usable_size(p);
+  while (trackedLock.test_and_set(std::memory_order_acquire)) {}
+  size_t i = trackedSlot(p), probes = 0;
+  while (tracked[i].p && ++probes < TRACKED_BLOCKS) i = (i + 1) & (TRACKED_BLOCKS - 1);
+  if (!tracked[i].p) tracked[i] = {p, size};
+  trackedLock.clear(std::memory_order_release);
+
+  long now = heapInUse += size;
+  long peak = heapPeak;
+  while (now > peak && !heapPeak.compare_exchange_weak(peak, now)) {}
+}
+
+// Size of the block if it was counted, 0 otherwise
+static size_t trackFree(void* p) {
+  if (!p) return 0;
+  size_t size = 0;
+  while (trackedLock.test_and_set(std::memory_order_acquire)) {}
+  size_t i = trackedSlot(p);
+  while (tracked[i].p && tracked[i].p != p) i = (i + 1) & (TRACKED_BLOCKS - 1);
+  if (tracked[i].p) {
+    size = tracked[i].size;
+    // Shift later entries of the probe run back into the gap
+    for (size_t j = (i + 1) & (TRACKED_BLOCKS - 1); tracked[j].p; j = (j + 1) & (TRACKED_BLOCKS - 1)) {
+      size_t home = trackedSlot(tracked[j].p);
+      if (((j - home) & (TRACKED_BLOCKS - 1)) >= ((j - i) & (TRACKED_BLOCKS - 1))) {
+        tracked[i] = tracked[j];
+        i = j;
+      }
+    }
+    tracked[i].p = nullptr;
+  }
+  trackedLock.clear(std::memory_order_release);
+  heapInUse -= size;
+  return size;
+}
+
+extern "C" void* malloc(size_t size) {
+  void* p = __libc_malloc(size);
+  if (mockSketchThread) trackAlloc(p);
+  return p;
+}
+
+extern "C" void* calloc(size_t n, size_t size) {
+  void* p = __libc_calloc(n, size);
+  if (mockSketchThread) trackAlloc(p);
+  return p;
+}
+
+extern "C" void* realloc(void* old, size_t size) {
+  size_t oldSize = old ? trackFree(old) : 0;
+  void* p = __libc_realloc(old, size);
+  if (!p && size != 0 && oldSize) {
+    trackAlloc(old);   // on failure the old block is still allocated
+  } else if (mockSketchThread || oldSize) {
+    trackAlloc(p);
+  }
+  return p;
+}
+
+extern "C" void free(void* p) {
+  trackFree(p);
+  __libc_free(p);
+}
+
+// ---- Latency samples
+
+struct Samples {
+  std::mutex lock;
+  std::vector<double> ms;
+
+  void add(double value) {
+    // Robot event samples are taken on the sketch's console thread
+    bool sketch = mockSketchThread;
+    mockSketchThread = false;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      ms.push_back(value);
+    }
+    mockSketchThread = sketch;
+  }
+
+  void report(const char* name, double seconds) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (ms.empty()) {
+      printf("  %-14s no samples\n", name);
+      return;
+    }
+    std::sort(ms.begin(), ms.end());
+    auto pct = [&](double p) { return ms[std::min(ms.size() - 1, (size_t)(p * ms.size()))]; };
+    printf("  %-14s %7zu  %8.1f/s  p50 %7.2f  p90 %7.2f  p99 %7.2f  max %7.2f ms\n", name,
+           ms.size(), ms.size() / seconds, pct(0.50), pct(0.90), pct(0.99), ms.back());
+  }
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedMs(Clock::time_point since) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+}
+
+// ---- Scripted Arduino: answers each command after a simulated cycle time
+
+struct ScriptedArduino {
+  int pickMs = 40;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::deque<String> commands;
+  std::mt19937 rng{42};
+
+  // Sent time of each result line, matched against the console echo
+  std::mutex sentLock;
+  std::deque<std::pair<std::string, Clock::time_point>> sent;
+  Samples eventLatency;
+
+  void receive(const String& line) {
+    std::lock_guard<std::mutex> guard(lock);
+    commands.push_back(line);
+    wake.notify_one();
+  }
+
+  // Lines go out in small pieces so the server sees partial UART lines
+  void reply(const std::string& line) {
+    {
+      std::lock_guard<std::mutex> guard(sentLock);
+      sent.emplace_back(line, Clock::now());
+    }
+    std::string text = line + "\r\n";
+    for (size_t i = 0; i < text.size(); i += 7) {
+      Serial2.inject(String(text.substr(i, 7)));
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  }
+
+  void echoed(const String& consoleLine) {
+    if (!consoleLine.startsWith("Arduino: ")) return;
+    std::string line = consoleLine.substring(9).c_str();
+    std::lock_guard<std::mutex> guard(sentLock);
+    for (auto it = sent.begin(); it != sent.end(); ++it) {
+      if (it->first == line) {
+        eventLatency.add(elapsedMs(it->second));
+        sent.erase(it);
+        return;
+      }
+    }
+  }
+
+  void run() {
+    reply("ARDUINO_READY");
+    for (;;) {
+      String cmd;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [this] { return !commands.empty(); });
+        cmd = commands.front();
+        commands.pop_front();
+      }
+
+      if (cmd == "HOME") {
+        delay(pickMs / 2);
+        reply("ACK:HOME");
+      } else if (cmd == "MAP") {
+        // Factory 3x4 layout, medicine id = row * 4 + col
+        reply("MAP:3x4");
+        for (int i = 0; i < 12; i++) {
+          reply("SLOT" + std::to_string(i / 4) + "-" + std::to_string(i % 4) + "X20.00Y0.00Z5.00K" +
+                std::to_string(i) + "F0");
+        }
+      } else if (cmd.startsWith("P")) {
+        int sku = cmd.substring(1).toInt();
+        int xPos = cmd.indexOf('x');
+        int units = xPos == -1 ? 1 : cmd.substring(xPos + 1).toInt();
+        std::string slot = std::to_string(sku / 4) + "-" + std::to_string(sku % 4);
+        int roll = rng() % 100;
+        reply("SLOT:" + slot);
+        delay(pickMs / 2);
+        if (roll < 5) {
+          reply("ERROR:MED_NOT_ON_AVAILBLE");
+          reply("DONE:" + std::string(cmd.c_str()));
+          continue;
+        }
+        for (int unit = 1; unit <= units; unit++) {
+          if (rng() % 100 < 10) {
+            reply("ERROR:BOX_NOT_ON_PLATFORM");
+            delay(pickMs / 2);
+          }
+          reply("BOX_ON_PLATFORM_CONFIRMED");
+          delay(pickMs / 2);
+          reply("UNIT_RETRIEVED:" + slot + ":" + std::to_string(unit) + "/" + std::to_string(units));
+        }
+        reply("ACK:S" + slot);
+        reply("MEDICINE_RETRIEVED:" + slot);
+      }
+      // The server sends the next command only after this
+      reply("DONE:" + std::string(cmd.c_str()));
+    }
+  }
+};
+
+ScriptedArduino arduino;
+
+// ---- Client traffic
+
+const char* searches[] = {"", "mg", "para", "in", "500", "zol", "inhaler", "x"};
+
+struct Traffic {
+  Samples page, catalog, log, cmd, all;
+  std::atomic<long> failures{0};
+
+  void client(int id, Clock::time_point end) {
+    std::mt19937 rng(id);
+    while (Clock::now() < end) {
+      int roll = rng() % 100;
+      std::string target;
+      Samples* bucket;
+      if (roll < 5) {
+        target = "/";
+        bucket = &page;
+      } else if (roll < 70) {
+        target = std::string("/api/catalog?q=") + searches[rng() % 8] + "&page=" + std::to_string(rng() % 2);
+        bucket = &catalog;
+      } else if (roll < 85) {
+        target = "/api/log?from=0&limit=50";
+        bucket = &log;
+      } else {
+        target = "/cmd?command=P" + std::to_string(rng() % 12) + "x" + std::to_string(1 + rng() % 3);
+        bucket = &cmd;
+      }
+
+      auto start = Clock::now();
+      MockResponse response = server.request(target).get();
+      double ms = elapsedMs(start);
+      if (response.code != 200 && !(bucket == &cmd && response.code == 503)) failures++;
+      bucket->add(ms);
+      all.add(ms);
+    }
+  }
+};
+
+int main(int argc, char** argv) {
+  int clients = 4;
+  int seconds = 5;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "--clients")) clients = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--seconds")) seconds = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--pick-ms")) arduino.pickMs = atoi(argv[i + 1]);
+  }
+
+  Serial.onLine = [](const String& line) { arduino.echoed(line); };
+  Serial2.onLine = [](const String& line) { arduino.receive(line); };
+  std::thread([] { arduino.run(); }).detach();
+
+  mockSketchThread = true;   // setup() runs on the sketch's main task
+  setup();
+  mockSketchThread = false;
+  delay(100);
+  long baseline = heapInUse;
+  heapPeak = baseline;
+
+  Traffic traffic;
+  auto end = Clock::now() + std::chrono::seconds(seconds);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < clients; i++) {
+    threads.emplace_back([&traffic, i, end] { traffic.client(i, end); });
+  }
+  for (auto& t : threads) t.join();
+
+  printf("%d clients, %d s, %d ms pick cycle\n", clients, seconds, arduino.pickMs);
+  printf("  %-14s %7s  %10s\n", "endpoint", "count", "rate");
+  traffic.all.report("all", seconds);
+  traffic.page.report("/", seconds);
+  traffic.catalog.report("/api/catalog", seconds);
+  traffic.log.report("/api/log", seconds);
+  traffic.cmd.report("/cmd", seconds);
+  arduino.eventLatency.report("robot events", seconds);
+  printf("  failures       %7ld\n", traffic.failures.load());
+  printf("  heap           %7ld bytes after setup, high-water %ld bytes (+%ld)\n", baseline,
+         heapPeak.load(), heapPeak.load() - baseline);
+  fflush(stdout);
+  _Exit(0);   // sketch tasks never return
+}